@@ -3,6 +3,7 @@
 /* standard C include files */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdarg.h>
 
@@ -16,6 +17,7 @@
 #include <libpurple/pluginpref.h>
 #include <libpurple/prefs.h>
 #include <libpurple/signals.h>
+#include <libpurple/util.h>
 #include <libpurple/version.h>
 
 /*  define my plugin parameters  */
@@ -43,6 +45,18 @@
 /* the time (in seconds) after a buddy joins a chat in which to set the topic */
 #define CHAT_BUDDY_JOINED_SET_TOPIC_TIMER 1
 
+/* the directory, inside the purple user directory, holding the topic history files */
+#define HISTORY_DIR "autotopic"
+
+/* the time (in seconds) after a topic history change in which to save the history files */
+#define HISTORY_SAVE_TIMER 30
+
+/* the number of topics remembered for each chatroom */
+#define HISTORY_ROOM_SIZE 10
+
+/* the number of topics kept in memory across all chatrooms */
+#define HISTORY_MAX_ENTRIES 4096
+
 /* debugging code to write to both debug window and system log ********/
 
 static gboolean debug_to_system_log = FALSE ;
@@ -63,6 +77,439 @@ debug_and_log(PurpleAccount *acct, PurpleDebugLevel level, char *cat, char *fmt,
     g_free(arg_s) ;
 }
 
+/* topic history handlers *********************************************/
+
+/*
+ *  Each watched chatroom keeps a ring buffer of its most recent topics.
+ *  Histories are stored one file per chatroom in the HISTORY_DIR
+ *  directory of the purple user directory, rather than in the
+ *  preferences, so that a chatroom's history is only read into memory
+ *  when that chatroom needs it.  Changed histories are written back on
+ *  a timer rather than on every topic change.
+ *
+ *  The loaded histories are a cache bounded by HISTORY_MAX_ENTRIES.
+ *  Loaded chatrooms are kept in least-recently-used order; once too
+ *  many entries are loaded, the least recently used chatroom is saved
+ *  if needed and dropped from memory, and is read back from its file
+ *  the next time it is needed.  Topic and setter strings are interned
+ *  in a reference-counted string table so identical strings share
+ *  storage.
+ */
+
+typedef struct _AutoTopicHistoryEntry {
+    const char *topic ;     /* interned topic string */
+    const char *who ;       /* interned setter name, or NULL if unknown */
+    time_t when ;           /* when the topic was recorded */
+} AutoTopicHistoryEntry ;
+
+typedef struct _AutoTopicHistory {
+    gchar *name ;           /* the conversation name */
+    guint first ;           /* index of the oldest entry in the ring */
+    guint count ;           /* number of entries in the ring */
+    gboolean dirty ;        /* TRUE if the history file needs to be saved */
+    GList *lru_link ;       /* this history's link in history_lru_queue */
+    AutoTopicHistoryEntry entries[HISTORY_ROOM_SIZE] ;
+} AutoTopicHistory ;
+
+/* conversation name -> AutoTopicHistory* for every loaded chatroom */
+static GHashTable *history_rooms = NULL ;
+
+/* AutoTopicHistory* for every loaded chatroom, least recently used at the head */
+static GQueue *history_lru_queue = NULL ;
+
+/* the number of entries in all loaded histories */
+static guint history_loaded_entries = 0 ;
+
+/* interned string -> reference count */
+static GHashTable *history_strings = NULL ;
+
+/* the pending history save timer, or 0 if none */
+static guint history_save_timer = 0 ;
+
+/*
+ *  const char *history_string_ref(const char *str)
+ *  Returns the interned copy of <str>, adding a reference to it.
+ *  Returns NULL if <str> is NULL.
+ */
+
+static const char *
+history_string_ref(const char *str) {
+    gpointer key, value ;
+    if (str == NULL) {
+        return NULL ;
+    }
+    if (g_hash_table_lookup_extended(history_strings, str, &key, &value)) {
+        g_hash_table_insert(history_strings, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(value) + 1)) ;
+    } else {
+        key = g_strdup(str) ;
+        g_hash_table_insert(history_strings, key, GUINT_TO_POINTER(1)) ;
+    }
+    return (const char *)key ;
+}
+
+/*
+ *  void history_string_unref(const char *str)
+ *  Drops a reference to the interned string <str>, freeing it when
+ *  the last reference goes away.
+ */
+
+static void
+history_string_unref(const char *str) {
+    guint refs ;
+    if (str == NULL) {
+        return ;
+    }
+    refs = GPOINTER_TO_UINT(g_hash_table_lookup(history_strings, str)) ;
+    if (refs <= 1) {
+        g_hash_table_remove(history_strings, str) ;
+        g_free((gpointer)str) ;
+    } else {
+        g_hash_table_insert(history_strings, (gpointer)str, GUINT_TO_POINTER(refs - 1)) ;
+    }
+}
+
+/*
+ *  gchar *history_filename(const char *name)
+ *  Returns the name of the history file for the conversation named <name>.
+ *  The caller must g_free the result.
+ */
+
+static gchar *
+history_filename(const char *name) {
+    return g_build_filename(purple_user_dir(), HISTORY_DIR, purple_escape_filename(name), NULL) ;
+}
+
+/*
+ *  AutoTopicHistoryEntry *history_entry(AutoTopicHistory *history, guint n)
+ *  Returns the <n>th most recent entry of <history>, where 0 is the
+ *  newest entry.  <n> must be less than history->count.
+ */
+
+static AutoTopicHistoryEntry *
+history_entry(AutoTopicHistory *history, guint n) {
+    return &(history -> entries[(history -> first + history -> count - 1 - n) % HISTORY_ROOM_SIZE]) ;
+}
+
+/*
+ *  void history_drop_oldest(AutoTopicHistory *history)
+ *  Removes the oldest entry from <history>.
+ */
+
+static void
+history_drop_oldest(AutoTopicHistory *history) {
+    AutoTopicHistoryEntry *entry = &(history -> entries[history -> first]) ;
+    history_string_unref(entry -> topic) ;
+    history_string_unref(entry -> who) ;
+    memset(entry, 0, sizeof(*entry)) ;
+    history -> first = (history -> first + 1) % HISTORY_ROOM_SIZE ;
+    history -> count -= 1 ;
+    history_loaded_entries -= 1 ;
+}
+
+/*
+ *  void history_append(AutoTopicHistory *history, const char *topic, const char *who, time_t when)
+ *  Adds a new entry to <history>, dropping the room's oldest entry if
+ *  its ring is full.
+ */
+
+static void
+history_append(AutoTopicHistory *history, const char *topic, const char *who, time_t when) {
+    AutoTopicHistoryEntry *entry ;
+    if (history -> count == HISTORY_ROOM_SIZE) {
+        history_drop_oldest(history) ;
+    }
+    entry = &(history -> entries[(history -> first + history -> count) % HISTORY_ROOM_SIZE]) ;
+    entry -> topic = history_string_ref(topic) ;
+    entry -> who = history_string_ref(who) ;
+    entry -> when = when ;
+    history -> count += 1 ;
+    history_loaded_entries += 1 ;
+}
+
+/*
+ *  AutoTopicHistory *history_new(const char *name)
+ *  Creates an empty history for the conversation named <name> and adds
+ *  it to the loaded histories as the most recently used.
+ */
+
+static AutoTopicHistory *
+history_new(const char *name) {
+    AutoTopicHistory *history = g_new0(AutoTopicHistory, 1) ;
+    history -> name = g_strdup(name) ;
+    g_hash_table_insert(history_rooms, history -> name, history) ;
+    g_queue_push_tail(history_lru_queue, history) ;
+    history -> lru_link = g_queue_peek_tail_link(history_lru_queue) ;
+    return history ;
+}
+
+/*
+ *  void history_free(gpointer data)
+ *  Hash table value destructor; releases every entry and the history itself.
+ */
+
+static void
+history_free(gpointer data) {
+    AutoTopicHistory *history = (AutoTopicHistory *)data ;
+    while (history -> count > 0) {
+        history_drop_oldest(history) ;
+    }
+    g_queue_delete_link(history_lru_queue, history -> lru_link) ;
+    g_free(history -> name) ;
+    g_free(history) ;
+}
+
+/*
+ *  void history_init(void)
+ *  Creates the history tables if they do not already exist.
+ */
+
+static void
+history_init(void) {
+    if (history_strings == NULL) {
+        /*  keys are freed by history_string_unref, not by the table  */
+        history_strings = g_hash_table_new(g_str_hash, g_str_equal) ;
+    }
+    if (history_lru_queue == NULL) {
+        history_lru_queue = g_queue_new() ;
+    }
+    if (history_rooms == NULL) {
+        history_rooms = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, history_free) ;
+    }
+}
+
+/*
+ *  void history_save(AutoTopicHistory *history)
+ *  Writes <history> to its history file, if the chatroom is still watched.
+ *  Each line of the file has the form "<when>\t<who>\t<topic>", oldest
+ *  first, with <who> and <topic> escaped by g_strescape so they cannot
+ *  contain tabs or newlines.
+ */
+
+static void
+history_save(AutoTopicHistory *history) {
+    gchar *chatroom_pref = g_strdup_printf("%s/%s", PREFS_ROOT, history -> name) ;
+    if (purple_prefs_exists(chatroom_pref)) {
+        gchar *dirname = g_build_filename(purple_user_dir(), HISTORY_DIR, NULL) ;
+        gchar *filename = history_filename(history -> name) ;
+        GString *contents = g_string_new(NULL) ;
+        guint n ;
+        for (n = history -> count ; n > 0 ; n--) {
+            AutoTopicHistoryEntry *entry = history_entry(history, n - 1) ;
+            gchar *who_esc = g_strescape((entry -> who ? entry -> who : ""), NULL) ;
+            gchar *topic_esc = g_strescape(entry -> topic, NULL) ;
+            g_string_append_printf(contents, "%" G_GINT64_FORMAT "\t%s\t%s\n", (gint64)(entry -> when), who_esc, topic_esc) ;
+            g_free(topic_esc) ;
+            g_free(who_esc) ;
+        }
+        purple_build_dir(dirname, 0700) ;
+        if (purple_util_write_data_to_file_absolute(filename, contents -> str, contents -> len)) {
+            debug_and_log(NULL, PURPLE_DEBUG_INFO, PLUGIN_ID, "history_save: file \"%s\" -> %u entries\n", filename, history -> count) ;
+        } else {
+            debug_and_log(NULL, PURPLE_DEBUG_ERROR, PLUGIN_ID, "history_save: could not write file \"%s\"\n", filename) ;
+        }
+        g_string_free(contents, TRUE) ;
+        g_free(filename) ;
+        g_free(dirname) ;
+    }
+    history -> dirty = FALSE ;
+    g_free(chatroom_pref) ;
+}
+
+/*
+ *  void history_trim(AutoTopicHistory *keep)
+ *  While more than HISTORY_MAX_ENTRIES entries are loaded, drops the
+ *  least recently used chatroom from memory, saving it first if it has
+ *  unsaved changes.  The chatroom <keep> is never dropped.
+ */
+
+static void
+history_trim(AutoTopicHistory *keep) {
+    while (history_loaded_entries > HISTORY_MAX_ENTRIES) {
+        AutoTopicHistory *history = (AutoTopicHistory *)g_queue_peek_head(history_lru_queue) ;
+        if ((history == NULL) || (history == keep)) {
+            break ;
+        }
+        if (history -> dirty) {
+            history_save(history) ;
+        }
+        debug_and_log(NULL, PURPLE_DEBUG_INFO, PLUGIN_ID, "history_trim: unloading \"%s\"\n", history -> name) ;
+        g_hash_table_remove(history_rooms, history -> name) ;
+    }
+}
+
+/*
+ *  AutoTopicHistory *history_lookup(const char *name, gboolean create)
+ *  Returns the history for the conversation named <name>, reading it
+ *  from its history file if it is not already in memory, and marks it
+ *  as the most recently used.  If there is no saved history, returns a
+ *  new empty history if <create> is TRUE, or NULL if it is FALSE.
+ */
+
+static AutoTopicHistory *
+history_lookup(const char *name, gboolean create) {
+    AutoTopicHistory *history ;
+    gchar *filename ;
+    gchar *contents = NULL ;
+    history_init() ;
+    history = (AutoTopicHistory *)g_hash_table_lookup(history_rooms, name) ;
+    if (history != NULL) {
+        g_queue_unlink(history_lru_queue, history -> lru_link) ;
+        g_queue_push_tail_link(history_lru_queue, history -> lru_link) ;
+        return history ;
+    }
+    filename = history_filename(name) ;
+    if (g_file_get_contents(filename, &contents, NULL, NULL)) {
+        gchar **lines = g_strsplit(contents, "\n", 0) ;
+        gchar **line ;
+        for (line = lines ; *line != NULL ; line++) {
+            gchar **fields = g_strsplit(*line, "\t", 3) ;
+            if ((fields[0] != NULL) && (fields[1] != NULL) && (fields[2] != NULL) && (fields[2][0] != '\0')) {
+                gchar *who = g_strcompress(fields[1]) ;
+                gchar *topic = g_strcompress(fields[2]) ;
+                /*  only create the history once there is an entry to put in it  */
+                if (history == NULL) {
+                    history = history_new(name) ;
+                }
+                history_append(
+                        history,
+                        topic,
+                        ((who[0] != '\0') ? who : NULL),
+                        (time_t)g_ascii_strtoll(fields[0], NULL, 10)
+                ) ;
+                g_free(topic) ;
+                g_free(who) ;
+            }
+            g_strfreev(fields) ;
+        }
+        g_strfreev(lines) ;
+        g_free(contents) ;
+    }
+    if ((history == NULL) && create) {
+        history = history_new(name) ;
+    }
+    if (history != NULL) {
+        history_trim(history) ;
+    }
+    debug_and_log(NULL, PURPLE_DEBUG_INFO, PLUGIN_ID, "history_lookup: file \"%s\" -> %u entries\n", filename, (history ? history -> count : 0)) ;
+    g_free(filename) ;
+    return history ;
+}
+
+/*
+ *  void history_flush(void)
+ *  Saves every changed history.
+ */
+
+static void
+history_flush(void) {
+    GHashTableIter iter ;
+    gpointer value ;
+    if (history_rooms == NULL) {
+        return ;
+    }
+    g_hash_table_iter_init(&iter, history_rooms) ;
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        AutoTopicHistory *history = (AutoTopicHistory *)value ;
+        if (history -> dirty) {
+            history_save(history) ;
+        }
+    }
+}
+
+/*
+ *  history_save_cb - timer callback to save changed histories
+ */
+
+static gboolean
+history_save_cb(gpointer user_data) {
+    history_save_timer = 0 ;
+    history_flush() ;
+    /* return FALSE to stop the timer from calling the callback again */
+    return FALSE ;
+}
+
+/*
+ *  void history_schedule_save(void)
+ *  Starts the history save timer if it is not already running.
+ */
+
+static void
+history_schedule_save(void) {
+    if (history_save_timer == 0) {
+        history_save_timer = purple_timeout_add_seconds(
+                HISTORY_SAVE_TIMER,
+                (GSourceFunc)history_save_cb,
+                NULL
+        ) ;
+    }
+}
+
+/*
+ *  void autotopic_history_add(PurpleConversation *conv, const char *topic, const char *who)
+ *  Records <topic>, set by <who>, as the newest topic for the conversation.
+ *  Blank topics and repeats of the newest topic are ignored.
+ */
+
+static void
+autotopic_history_add(PurpleConversation *conv, const char *topic, const char *who) {
+    AutoTopicHistory *history ;
+    if ((topic == NULL) || (topic[0] == '\0')) {
+        return ;
+    }
+    history = history_lookup(purple_conversation_get_name(conv), TRUE) ;
+    if ((history -> count > 0) && (strcmp(history_entry(history, 0) -> topic, topic) == 0)) {
+        return ;
+    }
+    debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "autotopic_history_add: conversation=\"%s\" who=\"%s\" topic=\"%s\"\n", purple_conversation_get_name(conv), (who ? who : ""), topic) ;
+    history_append(history, topic, who, time(NULL)) ;
+    history -> dirty = TRUE ;
+    history_trim(history) ;
+    history_schedule_save() ;
+}
+
+/*
+ *  void autotopic_history_forget(PurpleConversation *conv)
+ *  Discards the topic history for the conversation, both in memory
+ *  and in its history file.
+ */
+
+static void
+autotopic_history_forget(PurpleConversation *conv) {
+    const char *name = purple_conversation_get_name(conv) ;
+    gchar *filename = history_filename(name) ;
+    if (history_rooms != NULL) {
+        g_hash_table_remove(history_rooms, name) ;
+    }
+    g_unlink(filename) ;
+    g_free(filename) ;
+}
+
+/*
+ *  void autotopic_history_shutdown(void)
+ *  Saves any changed histories and releases all history memory.
+ */
+
+static void
+autotopic_history_shutdown(void) {
+    if (history_save_timer != 0) {
+        purple_timeout_remove(history_save_timer) ;
+        history_save_timer = 0 ;
+    }
+    history_flush() ;
+    if (history_rooms != NULL) {
+        g_hash_table_destroy(history_rooms) ;
+        history_rooms = NULL ;
+    }
+    if (history_lru_queue != NULL) {
+        g_queue_free(history_lru_queue) ;
+        history_lru_queue = NULL ;
+    }
+    if (history_strings != NULL) {
+        g_hash_table_destroy(history_strings) ;
+        history_strings = NULL ;
+    }
+}
+
 /* conversation and preference topic handlers *************************/
 
 /*
@@ -197,6 +644,7 @@ autotopic_remove_topic(PurpleConversation *conv) {
     purple_prefs_set_string(topic_pref, NULL) ;
     purple_prefs_remove(topic_pref) ;
     purple_prefs_remove(set_on_join_pref) ;
+    autotopic_history_forget(conv) ;
     purple_prefs_remove(chatroom_pref) ;
     debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "autotopic_remove_topic: pref \"%s\" -> XX\n", chatroom_pref) ;
     g_free(topic_pref) ;
@@ -232,14 +680,15 @@ autotopic_send_topic_change(PurpleConversation *conv) {
 }
 
 /*
- *  void autotopic_handle_topic_change(PurpleConversation *conv, const char *topic)
+ *  void autotopic_handle_topic_change(PurpleConversation *conv, const char *topic, const char *who)
  *  Handle a conversation change.  If the chatroom has autotopic enabled,
- *  then either change the saved topic to the new chatroom topic, or
- *  (if the new chatroom topic is blank) set the chatroom topic to the
+ *  then either change the saved topic to the new chatroom topic and
+ *  record it in the topic history as set by <who> (which may be NULL),
+ *  or (if the new chatroom topic is blank) set the chatroom topic to the
  *  saved topic.
  */
 
-static void autotopic_handle_topic_change(PurpleConversation *conv, const char *new_topic) {
+static void autotopic_handle_topic_change(PurpleConversation *conv, const char *new_topic, const char *who) {
     const char *topic_for_chat;
     debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "autotopic_handle_topic_change: conversation=\"%s\" new_topic=\"%s\"\n", purple_conversation_get_name(conv), new_topic) ;
     topic_for_chat = autotopic_get_topic(conv) ;
@@ -248,6 +697,7 @@ static void autotopic_handle_topic_change(PurpleConversation *conv, const char *
             autotopic_send_topic_change(conv) ;
         } else {
             autotopic_set_topic(conv, new_topic) ;
+            autotopic_history_add(conv, new_topic, who) ;
         }
     }
     return ;
@@ -263,7 +713,7 @@ static void autotopic_handle_topic_change(PurpleConversation *conv, const char *
 static void
 chat_topic_changed_cb(PurpleConversation *conv, const char *who, const char *topic, void *data) {
     debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "Topic changed: who=\"%s\" account username=\"%s\" topic=\"%s\".\n", who, purple_account_get_username(purple_conversation_get_account(conv)), topic) ;
-    autotopic_handle_topic_change(conv, topic) ;
+    autotopic_handle_topic_change(conv, topic, who) ;
     return ;
 }
 
@@ -275,7 +725,7 @@ static gboolean
 check_topic_cb(gpointer user_data) {
     PurpleConversation *conv = (PurpleConversation*)user_data ;
     debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "Check Topic callback: conversation=\"%s\".\n", purple_conversation_get_name(conv) ) ;
-    autotopic_handle_topic_change(conv, purple_conv_chat_get_topic(purple_conversation_get_chat_data(conv))) ;
+    autotopic_handle_topic_change(conv, purple_conv_chat_get_topic(purple_conversation_get_chat_data(conv)), NULL) ;
     /* return FALSE to stop the timer from calling the callback again */
     return FALSE ;
 }
@@ -392,13 +842,17 @@ check_all_chats() {
  *      turns off autotopic for the current [chat] conversation
  *    /autotopic status
  *      reports whether autotopic is turned on or off for the current [chat] conversation
+ *    /autotopic history
+ *      lists the remembered topics for the current [chat] conversation, newest first
+ *    /autotopic restore N
+ *      sets the topic to the Nth topic listed by /autotopic history
  */
 
 static PurpleCmdId autotopic_cmd_id = 0;
 /* the autotopic command word */
 #define AUTOTOPIC_CMD_WORD "autotopic"
-/* the arguments to the autotopic command:  one word with no formatting */
-#define AUTOTOPIC_CMD_ARGS "w"
+/* the arguments to the autotopic command:  one word, then the rest of the line, with no formatting */
+#define AUTOTOPIC_CMD_ARGS "ws"
 /* the priority of the autotopic command: plugin default */
 #define AUTOTOPIC_CMD_PRI PURPLE_CMD_P_PLUGIN
 /* the autotopic command flags: chatroom command */
@@ -410,7 +864,9 @@ static PurpleCmdId autotopic_cmd_id = 0;
 /* the autotopic command help string */
 #define AUTOTOPIC_CMD_HELP "autotopic on|off:  turn autotopic on or off for the current chatroom.\n\
 autotopic status:  report the status of the current chatroom.\n\
-autotopic join|nojoin:  turn on or off setting the topic when new users join the chatroom (implies \"autotopic on\" as well)."
+autotopic join|nojoin:  turn on or off setting the topic when new users join the chatroom (implies \"autotopic on\" as well).\n\
+autotopic history:  list the remembered topics for the current chatroom, newest first.\n\
+autotopic restore N:  set the topic to the Nth topic listed by \"autotopic history\"."
 
 static PurpleCmdRet autotopic_cmd_cb(PurpleConversation *conv,
                               const gchar* cmd,
@@ -422,8 +878,8 @@ static PurpleCmdRet autotopic_cmd_cb(PurpleConversation *conv,
     *error = NULL ;
     /* check arguments. */
     debug_and_log(purple_conversation_get_account(conv), PURPLE_DEBUG_INFO, PLUGIN_ID, "autotopic option %s%s%s.\n", ((args && args[0]) ? "\"" : "") , ((args && args[0]) ? args[0] : "NULL") , ((args && args[0]) ? "\"" : "") ) ;
-    /* were we given too many arguments? */
-    if (args && args[0] && args[1]) {
+    /* were we given too many arguments?  only "restore" takes a second one. */
+    if (args && args[0] && args[1] && (strcmp(args[0], "restore") != 0)) {
         *error = g_strdup_printf("Too many arguments to the autotopic command.") ;
         ret = PURPLE_CMD_RET_FAILED ;
     /* if no arguments, or argument is "status", report status. */
@@ -441,6 +897,7 @@ static PurpleCmdRet autotopic_cmd_cb(PurpleConversation *conv,
     } else if (strcmp(args[0], "on") == 0) {
         const char *topic = purple_conv_chat_get_topic(purple_conversation_get_chat_data(conv)) ;
         autotopic_set_topic(conv, topic) ;
+        autotopic_history_add(conv, topic, NULL) ;
         msg = g_strdup_printf("autotopic is now on for this chat.") ;
     /* if argument is "off", turn off autotopic. */
     } else if (strcmp(args[0], "off") == 0) {
@@ -454,6 +911,60 @@ static PurpleCmdRet autotopic_cmd_cb(PurpleConversation *conv,
     } else if (strcmp(args[0], "nojoin") == 0) {
         autotopic_set_set_on_join(conv, FALSE) ;
         msg = g_strdup_printf("autotopic will NOT set the topic when new users join this chat.") ;
+    /* if argument is "history", list the remembered topics. */
+    } else if (strcmp(args[0], "history") == 0) {
+        if (autotopic_get_topic(conv) == NULL) {
+            msg = g_strdup_printf("autotopic is off for this chat.") ;
+        } else {
+            AutoTopicHistory *history = history_lookup(purple_conversation_get_name(conv), FALSE) ;
+            guint n ;
+            if (history == NULL) {
+                msg = g_strdup_printf("autotopic has no topic history for this chat.") ;
+            }
+            for (n = 0 ; (history != NULL) && (n < history -> count) ; n++) {
+                AutoTopicHistoryEntry *entry = history_entry(history, n) ;
+                gchar *topic_html = g_markup_escape_text(entry -> topic, -1) ;
+                gchar *who_html = g_markup_escape_text((entry -> who ? entry -> who : "unknown"), -1) ;
+                gchar *line = g_strdup_printf("%u: [%s] %s: %s", n + 1, purple_utf8_strftime("%Y-%m-%d %H:%M", localtime(&(entry -> when))), who_html, topic_html) ;
+                purple_conversation_write(conv, NULL, line, PURPLE_MESSAGE_SYSTEM, time(NULL)) ;
+                g_free(line) ;
+                g_free(who_html) ;
+                g_free(topic_html) ;
+            }
+        }
+    /* if argument is "restore", set the topic from the topic history. */
+    } else if (strcmp(args[0], "restore") == 0) {
+        AutoTopicHistory *history = NULL ;
+        /*  "ws" passes everything after the first space, so strip the spacing around N  */
+        gchar *number = (args[1] ? g_strstrip(g_strdup(args[1])) : NULL) ;
+        gchar *endptr = NULL ;
+        guint64 n = 0 ;
+        if (autotopic_get_topic(conv) == NULL) {
+            *error = g_strdup_printf("autotopic is off for this chat.") ;
+            ret = PURPLE_CMD_RET_FAILED ;
+        } else if ((number == NULL) || (number[0] == '\0')) {
+            *error = g_strdup_printf("Usage: autotopic restore N") ;
+            ret = PURPLE_CMD_RET_FAILED ;
+        } else {
+            history = history_lookup(purple_conversation_get_name(conv), FALSE) ;
+            /*  N itself must be all digits  */
+            n = g_ascii_strtoull(number, &endptr, 10) ;
+            if (!g_ascii_isdigit(number[0]) || (*endptr != '\0') || (n < 1) || (history == NULL) || (n > history -> count)) {
+                *error = g_strdup_printf("Invalid topic history number \"%s\"", number) ;
+                ret = PURPLE_CMD_RET_FAILED ;
+            } else {
+                /*
+                 *  copy the topic:  on some protocols sending the topic change
+                 *  fires chat-topic-changed synchronously, which records a new
+                 *  history entry and may drop the one we are restoring.
+                 */
+                gchar *topic = g_strdup(history_entry(history, (guint)(n - 1)) -> topic) ;
+                autotopic_set_topic(conv, topic) ;
+                autotopic_send_topic_change(conv) ;
+                g_free(topic) ;
+            }
+        }
+        g_free(number) ;
     /* otherwise, invalid argument... */
     } else {
         *error = g_strdup_printf("Invalid autotopic option \"%s\"", args[0]) ;
@@ -592,12 +1103,13 @@ plugin_load_hook(PurplePlugin *plugin) {
 
 /*  Unload the plugin.
  *  Called by the plugin system when the plugin is unloaded.
- *  Currently does nothing.
+ *  Saves and releases the topic history.
  */
 static gboolean
 plugin_unload_hook(PurplePlugin *plugin) {
     debug_and_log(NULL, PURPLE_DEBUG_INFO, PLUGIN_ID, "Plugin Unloaded.\n") ;
-    /*  We don't need to do anything special here  */
+    /*  write out any pending topic history  */
+    autotopic_history_shutdown() ;
     /*  return TRUE says continue unloading the plugin  */
     return TRUE ;
 }